@@ -222,6 +222,12 @@ void print_help(const char *name) {
     printf("  toggle-excluded <token>   Toggle presence of <token> in excluded types (substring match by default).\n");
     printf("                            Use --exact to only match exact tokens.\n");
     printf("  status                 Show current status\n");
+    printf("  timing                 Show control tick lateness/jitter/work histograms (JSON, accepts --pretty/-p)\n");
+    printf("  actuator               Show per-policy frequency write counts and errors (JSON, accepts --pretty/-p)\n");
+    printf("  set-aggregation <mode> Combine sensors: single, mean, max, trimmed, p90, weighted\n");
+    printf("  clusters               Show CPU clusters (or cores) with their sensors, temperatures and caps (JSON, accepts --pretty/-p)\n");
+    printf("  set-control-mode <m>   Throttle curve (curve), PID on a setpoint (pid) or model-predictive (mpc)\n");
+    printf("  set-throttle-scope <s> Cap all CPUs together (global), per CPU cluster (cluster) or per core (core)\n");
     printf("  quit                   Shutdown cpu_throttle daemon\n");
     printf("\nProfile commands:\n");
     printf("  save-profile <name>    Save current settings to a profile\n");
@@ -828,6 +834,21 @@ int main(int argc, char *argv[]) {
         }
         return send_command("sensors");
     }
+    // clusters JSON lists every cluster's CPUs and sensors and outgrows a single recv; read to EOF
+    if (strcmp(argv[1], "clusters") == 0) {
+        int pretty = (argc >= 3 && (strcmp(argv[2], "--pretty") == 0 || strcmp(argv[2], "-p") == 0)) ? 1 : 0;
+        char *resp = send_command_get_response("clusters"); if (!resp) { fprintf(stderr, "Error: failed to query clusters\n"); return 1; } if (pretty) print_json_pretty_or_raw(resp); else printf("%s\n", resp); free(resp); return 0;
+    }
+    // timing JSON (three histograms) outgrows a single recv; read to EOF
+    if (strcmp(argv[1], "timing") == 0) {
+        int pretty = (argc >= 3 && (strcmp(argv[2], "--pretty") == 0 || strcmp(argv[2], "-p") == 0)) ? 1 : 0;
+        char *resp = send_command_get_response("timing"); if (!resp) { fprintf(stderr, "Error: failed to query timing\n"); return 1; } if (pretty) print_json_pretty_or_raw(resp); else printf("%s\n", resp); free(resp); return 0;
+    }
+    // actuator JSON has one entry per policy and outgrows a single recv; read to EOF
+    if (strcmp(argv[1], "actuator") == 0) {
+        int pretty = (argc >= 3 && (strcmp(argv[2], "--pretty") == 0 || strcmp(argv[2], "-p") == 0)) ? 1 : 0;
+        char *resp = send_command_get_response("actuator"); if (!resp) { fprintf(stderr, "Error: failed to query actuator\n"); return 1; } if (pretty) print_json_pretty_or_raw(resp); else printf("%s\n", resp); free(resp); return 0;
+    }
 
     // get-excluded-types: support optional --json/-j or --pretty/-p
     if (strcmp(argv[1], "get-excluded-types") == 0) {
@@ -57,6 +57,14 @@ echo "Running normalization tests..."
 chmod +x "$ROOT/tests/test_normalize_excluded_types.sh"
 "$ROOT/tests/test_normalize_excluded_types.sh"
 
+echo "Running replay tests..."
+chmod +x "$ROOT/tests/test_replay.sh"
+"$ROOT/tests/test_replay.sh"
+
+echo "Running simulator tests..."
+chmod +x "$ROOT/tests/test_simulate.sh"
+"$ROOT/tests/test_simulate.sh"
+
 echo "🎉 All comprehensive tests passed!"
 echo ""
 echo "Test coverage:"
@@ -64,5 +72,6 @@ echo "  • Build verification"
 echo "  • Complete API endpoint testing"
 echo "  • Complete CTL command/flag testing"
 echo "  • Legacy regression tests (excluded-types)"
+echo "  • Trace replay and closed-loop simulator"
 echo ""
 exit 0
@@ -0,0 +1,71 @@
+#!/usr/bin/env bash
+set -euo pipefail
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BIN=${ROOT}/cpu_throttle
+PORT=${HOTPLUG_TEST_PORT:-18096}
+TMP=$(mktemp -d)
+SYS=$TMP/sys
+CPUDIR=$SYS/devices/system/cpu
+PID=
+cleanup() { [[ -n "$PID" ]] && kill "$PID" 2>/dev/null; wait 2>/dev/null || true; rm -rf "$TMP"; }
+trap cleanup EXIT
+
+field() { curl -s "http://localhost:$PORT/api/status" | grep -o "\"$1\":[0-9]*" | head -1 | cut -d: -f2; }
+
+# Wait up to 5 s for a status field to reach a value
+wait_field() {
+  for _ in $(seq 50); do
+    [[ "$(field "$1")" == "$2" ]] && return 0
+    sleep 0.1
+  done
+  return 1
+}
+
+echo "Testing CPU hotplug resync"
+
+# A fixed cap below the hardware maximum, so a pushed write is easy to tell from the reset value
+"$BIN" --simulate --sysfs-root "$SYS" --sim-cpus 4 --sim-load 0@600 --safe-max 2000000 --web-port "$PORT" --quiet &
+PID=$!
+for _ in $(seq 50); do
+  curl -s "http://localhost:$PORT/api/status" >/dev/null 2>&1 && break
+  sleep 0.1
+done
+if ! wait_field targets 4 || [[ "$(cat "$CPUDIR/cpufreq/policy3/scaling_max_freq")" != 2000000 ]]; then
+  echo "policy3 was not capped at start"; exit 1
+fi
+
+# CPU 3 goes offline and its policy disappears
+echo "0-2" > "$CPUDIR/online"
+rm -rf "$CPUDIR/cpufreq/policy3" "$CPUDIR/cpu3/cpufreq"
+if ! wait_field targets 3; then
+  echo "the removed policy is still a target ($(field targets) targets)"; exit 1
+fi
+echo "Policy removal: PASS"
+
+# It comes back with the kernel's reset limits
+pushes=$(field hotplug_pushes)
+mkdir -p "$CPUDIR/cpufreq/policy3"
+for f in cpuinfo_min_freq scaling_min_freq; do echo 800000 > "$CPUDIR/cpufreq/policy3/$f"; done
+for f in cpuinfo_max_freq scaling_max_freq scaling_cur_freq; do echo 4000000 > "$CPUDIR/cpufreq/policy3/$f"; done
+echo 3 > "$CPUDIR/cpufreq/policy3/related_cpus"
+echo 3 > "$CPUDIR/cpufreq/policy3/affected_cpus"
+ln -s ../cpufreq/policy3 "$CPUDIR/cpu3/cpufreq"
+echo "0-3" > "$CPUDIR/online"
+if ! wait_field targets 4; then
+  echo "the returning policy was not picked up ($(field targets) targets)"; exit 1
+fi
+cap=
+for _ in $(seq 50); do
+  cap=$(cat "$CPUDIR/cpufreq/policy3/scaling_max_freq")
+  [[ "$cap" == 2000000 ]] && break
+  sleep 0.1
+done
+if [[ "$cap" != 2000000 ]]; then
+  echo "the cap was not pushed to the returning CPU (scaling_max_freq ${cap})"; exit 1
+fi
+if (( $(field hotplug_pushes) <= pushes )); then
+  echo "no hotplug push was recorded"; exit 1
+fi
+echo "Policy re-add: PASS"
+
+echo "Hotplug tests passed"
@@ -0,0 +1,53 @@
+#!/usr/bin/env bash
+set -euo pipefail
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BIN=${ROOT}/cpu_throttle
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+echo "Testing --replay"
+
+# 10 minutes at 2 Hz: 30 s bursts of full load between idle stretches, heading past 95°C
+awk 'BEGIN { print "# max_khz=4000000 min_khz=800000"; T = 50
+  for (i = 0; i < 1200; i++) { t = i * 0.5; load = (int(t / 30) % 2) ? 1 : 0.2
+    T += 0.5 * (-0.1 * (T - 35) + 6.5 * load); printf "%.1f,%.2f,%.2f\n", t, T, load } }' > "$TMP/trace.csv"
+printf 'temp_max=85\ncurve=60:100%%,80:60%%\n' > "$TMP/cool.config"
+printf 'control_mode=pid\n' > "$TMP/pid.config"
+
+out=$("$BIN" --replay "$TMP/trace.csv" --replay-profile "$TMP/cool.config" --replay-profile "$TMP/pid.config" --json)
+echo "$out"
+for key in '"samples":1200' '"profile":"current"' '"profile":"'"$TMP"'/cool.config"' '"control_mode":"pid"' '"time_over_s":' '"mhz_s_lost":' '"actuations":' '"oscillations":'; do
+  if [[ "$out" != *"$key"* ]]; then
+    echo "replay JSON is missing $key"; exit 1
+  fi
+done
+
+# A lower temp_max and a harder curve must give up more clock than the defaults
+lost() { echo "$out" | grep -o '"mhz_s_lost":[0-9]*' | sed -n "$1p" | cut -d: -f2; }
+if (( $(lost 2) <= $(lost 1) )); then
+  echo "cool profile gave up $(lost 2) MHz*s, not more than the default's $(lost 1)"; exit 1
+fi
+echo "Profile comparison: PASS"
+
+# The text report has one row per run
+rows=$("$BIN" --replay "$TMP/trace.csv" --replay-profile "$TMP/cool.config" | grep -c -E '^(current|/)')
+if [[ "$rows" != 2 ]]; then
+  echo "text report has $rows rows, expected 2"; exit 1
+fi
+
+# Bad input is an error, not an empty report
+printf '0 50\n1 51\n0.5 52\n' > "$TMP/backwards.csv"
+if "$BIN" --replay "$TMP/backwards.csv" >/dev/null 2>&1; then
+  echo "a trace going back in time was accepted"; exit 1
+fi
+if "$BIN" --replay "$TMP/trace.csv" --replay-profile "$TMP/missing.config" >/dev/null 2>&1; then
+  echo "a missing profile was accepted"; exit 1
+fi
+many=()
+for _ in $(seq 9); do many+=(--replay-profile "$TMP/cool.config"); done
+if "$BIN" --replay "$TMP/trace.csv" "${many[@]}" >/dev/null 2>&1; then
+  echo "a ninth profile was accepted"; exit 1
+fi
+echo "Input validation: PASS"
+
+echo "Replay tests passed"
@@ -0,0 +1,78 @@
+#!/usr/bin/env bash
+set -euo pipefail
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BIN=${ROOT}/cpu_throttle
+PORT=${SIM_TEST_PORT:-18095}
+TMP=$(mktemp -d)
+PID=
+cleanup() { [[ -n "$PID" ]] && kill "$PID" 2>/dev/null; wait 2>/dev/null || true; rm -rf "$TMP"; }
+trap cleanup EXIT
+
+field() { curl -s "http://localhost:$PORT/api/$1" | grep -o "\"$2\":[0-9]*" | head -1 | cut -d: -f2; }
+
+start() {
+  "$BIN" --simulate --sysfs-root "$TMP/sys" --web-port "$PORT" --quiet "$@" &
+  PID=$!
+  for _ in $(seq 50); do
+    curl -s "http://localhost:$PORT/api/status" >/dev/null 2>&1 && return 0
+    sleep 0.1
+  done
+  echo "simulated daemon did not come up"; exit 1
+}
+
+stop() { kill "$PID"; wait "$PID" 2>/dev/null || true; PID=; }
+
+echo "Testing --simulate"
+
+# Closed loop: at full load the unthrottled plant would pass 100°C within 20 s
+start --sim-cpus 8 --sim-load 1@600 --temp-max 80
+peak=0
+for _ in $(seq 20); do
+  sleep 1
+  t=$(field status temperature)
+  (( t > peak )) && peak=$t
+done
+freq=$(field status frequency)
+stop
+echo "peak ${peak}°C, cap ${freq} kHz"
+if (( peak < 60 )); then
+  echo "the plant did not heat up"; exit 1
+fi
+if (( peak > 80 )); then
+  echo "temperature reached ${peak}°C with temp_max=80"; exit 1
+fi
+if (( freq >= 4000000 )); then
+  echo "the cap never came down"; exit 1
+fi
+echo "Closed loop: PASS"
+
+# Scale: every simulated policy becomes a target, and each tick's cost is recorded
+start --sim-cpus 512 --sim-sensors 17
+sleep 3
+targets=$(curl -s "http://localhost:$PORT/api/status" | grep -o '"targets":[0-9]*' | head -1 | cut -d: -f2)
+work=$(curl -s "http://localhost:$PORT/api/timing" | grep -o '"work_us":{"count":[0-9]*,"mean":[0-9]*')
+curl -s -X POST -d '{"value":0}' "http://localhost:$PORT/api/settings/safe-min" >/dev/null
+stop
+echo "targets ${targets}, ${work}"
+if [[ "$targets" != 512 ]]; then
+  echo "expected 512 frequency targets, got ${targets:-none}"; exit 1
+fi
+if [[ "$work" != *'"count":'[1-9]* ]]; then
+  echo "no tick work time recorded"; exit 1
+fi
+echo "Scaling: PASS"
+if [[ ! -f "$TMP/sys/cpu_throttle.conf" || ! -d "$TMP/sys/profiles" ]]; then
+  echo "settings and profiles were not kept under the simulated root"; exit 1
+fi
+echo "Config isolation: PASS"
+
+# The simulation refuses the real tree and bad options
+if "$BIN" --simulate --sysfs-root /sys --quiet >/dev/null 2>&1; then
+  echo "--simulate accepted /sys as its root"; exit 1
+fi
+if "$BIN" --simulate --sim-load 2@10 --quiet >/dev/null 2>&1; then
+  echo "a load above 1 was accepted"; exit 1
+fi
+echo "Input validation: PASS"
+
+echo "Simulator tests passed"